@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "mm.h"
 
@@ -59,6 +60,63 @@ START_TEST (test_simple_allocation)
 
 END_TEST
 
+#if defined(MM_WILDERNESS) && !defined(MM_PERSISTENT)
+/**
+ * @name   Wilderness unit test
+ * @brief  Tests bump allocation on a fresh heap, so it runs first.
+ *
+ * New blocks are carved from the wilderness with no slack, a block freed
+ * next to the wilderness is merged back into it, and other freed blocks
+ * are reused before the wilderness is touched. A free run that ends at the
+ * wilderness is merged back too.
+ */
+START_TEST (test_wilderness)
+{
+  void *ptr1 = MALLOC(256);
+  void *ptr2 = MALLOC(256);
+  void *ptr3;
+  void *ptr4;
+
+  ck_assert(ptr2 > ptr1);
+  ck_assert(simple_usable_size(ptr1) == 256);
+  FREE(ptr2);
+  ptr3 = MALLOC(256);
+  ck_assert(ptr3 == ptr2);
+  FREE(ptr1);
+  ptr4 = MALLOC(256);
+  ck_assert(ptr4 == ptr1);
+  FREE(ptr4);
+  FREE(ptr3);
+  ptr1 = MALLOC(1024);   /* Fits only in the wilderness with both blocks back in it */
+  ck_assert(ptr1 == ptr4);
+  FREE(ptr1);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+
+/**
+ * @name   Wilderness free run unit test
+ * @brief  Tests that blocks freed in address order all go back to the wilderness.
+ */
+START_TEST (test_wilderness_run)
+{
+  void *ptrs[8];
+  void *ptr;
+  int i;
+
+  for (i = 0; i < 8; i++) ptrs[i] = MALLOC(256);
+  for (i = 0; i < 8; i++) {
+    FREE(ptrs[i]);
+    ck_assert_int_eq(simple_heap_check(), 0);
+  }
+  ptr = MALLOC(2000);   /* Larger than any hole the run could leave */
+  ck_assert(ptr == ptrs[0]);
+  FREE(ptr);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+#endif
+
 /**
  * @name   Example allocation overlap unit test.
  * @brief  Tests whether two allocations overlap.
@@ -276,6 +334,284 @@ START_TEST (test_memory_exerciser)
 
 END_TEST
 
+/**
+ * @name   Heap integrity check unit test
+ * @brief  Tests that the block list verifies after allocations and frees.
+ */
+START_TEST (test_heap_check)
+{
+  void *ptr1 = MALLOC(100);
+  void *ptr2 = MALLOC(200);
+  void *ptr3 = MALLOC(300);
+
+  ck_assert_int_eq(simple_heap_check(), 0);
+  FREE(ptr2);
+  ck_assert_int_eq(simple_heap_check(), 0);
+  FREE(ptr1);
+  FREE(ptr3);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+
+/**
+ * @name   Fit policy unit test
+ * @brief  Tests where a block freed at the start of the heap is reused.
+ *
+ * First fit hands the freed block out again, next fit continues after
+ * the last allocation. With a wilderness block next fit wraps around to
+ * any earlier hole instead, so the address is not checked. In all cases
+ * the roving pointer must remain a valid block when the block it points
+ * at is merged. The blocks are too large for the size class caches.
+ */
+START_TEST (test_fit_policy)
+{
+  void *ptr1 = MALLOC(256);
+  void *ptr2 = MALLOC(256);
+  void *ptr3 = MALLOC(256);
+  void *ptr4;
+
+  FREE(ptr1);
+  ptr4 = MALLOC(256);
+#if !defined(MM_NEXT_FIT)
+  ck_assert(ptr4 == ptr1);
+#elif !defined(MM_WILDERNESS)
+  ck_assert(ptr4 != ptr1);
+#endif
+  FREE(ptr4);
+  FREE(ptr3);
+  ck_assert_int_eq(simple_heap_check(), 0);
+  FREE(ptr2);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+
+/**
+ * @name   Heap export unit test
+ * @brief  Tests that both snapshot formats describe the same heap.
+ */
+START_TEST (test_heap_export)
+{
+  void *ptrs[8];
+  char line[128];
+  unsigned long offset, size, csv_bytes = 0;
+  int free_flag, n, csv_cached = 0, binary_cached = 0;
+  SimpleExportHeader header;
+  SimpleExportRun run;
+  uint64_t binary_bytes = 0;
+  FILE *out;
+
+  for (n = 0; n < 8; n++) ptrs[n] = MALLOC(64 * (n + 1));
+  for (n = 0; n < 8; n += 2) FREE(ptrs[n]);
+
+  out = tmpfile();
+  ck_assert_int_eq(simple_heap_export(out, SIMPLE_EXPORT_CSV), 0);
+  rewind(out);
+  ck_assert(fgets(line, sizeof(line), out) != NULL);
+  while (fscanf(out, "%lu,%lu,%d", &offset, &size, &free_flag) == 3) {
+    ck_assert(offset == csv_bytes);
+    csv_bytes += size;
+    if (free_flag == 3) csv_cached++;
+  }
+  fclose(out);
+
+  out = tmpfile();
+  ck_assert_int_eq(simple_heap_export(out, SIMPLE_EXPORT_BINARY), 0);
+  rewind(out);
+  ck_assert(fread(&header, sizeof(header), 1, out) == 1);
+  ck_assert(memcmp(header.magic, SIMPLE_EXPORT_MAGIC, sizeof(header.magic)) == 0);
+  while (fread(&run, sizeof(run), 1, out) == 1) {
+    ck_assert(run.offset == binary_bytes);
+    binary_bytes += run.size;
+    if (run.free == 3) binary_cached += run.blocks;
+  }
+  fclose(out);
+
+  ck_assert(csv_bytes == header.heap_size);
+  ck_assert(binary_bytes == header.heap_size);
+
+  /* Every block in a size class cache, the freed 64 byte one among them, is exported as cached */
+#ifdef MM_SIZE_CACHE
+  int cached = 0;
+  for (n = 0; n < SIMPLE_CACHE_CLASSES; n++) cached += simple_cache_count[n];
+  ck_assert(cached >= 1);
+  ck_assert_int_eq(csv_cached, cached);
+#else
+  ck_assert_int_eq(csv_cached, 0);
+#endif
+  ck_assert_int_eq(binary_cached, csv_cached);
+
+  for (n = 1; n < 8; n += 2) FREE(ptrs[n]);
+}
+END_TEST
+
+/**
+ * @name   Root pointer unit test
+ * @brief  Tests that root pointers are stored and out of range indexes are ignored.
+ */
+START_TEST (test_roots)
+{
+  int *ptr = MALLOC(sizeof(int));
+
+  simple_set_root(0, ptr);
+  simple_set_root(SIMPLE_ROOTS, ptr);
+  ck_assert(simple_get_root(0) == ptr);
+  ck_assert(simple_get_root(SIMPLE_ROOTS) == NULL);
+  simple_set_root(0, NULL);
+  FREE(ptr);
+}
+END_TEST
+
+#ifdef MM_SIZE_CACHE
+/**
+ * @name   Size class cache unit test
+ * @brief  Tests that a freed small block is reused for the same size class,
+ *         through both the inline and the out-of-line allocator.
+ */
+START_TEST (test_size_cache)
+{
+  volatile size_t size = 24;
+  void *ptr1 = MALLOC(24);
+  void *ptr2;
+
+  FREE(ptr1);
+  ptr2 = MALLOC(24);
+  ck_assert(ptr2 == ptr1);
+  FREE(ptr2);
+  ptr2 = MALLOC(size);
+  ck_assert(ptr2 == ptr1);
+  FREE(ptr2);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+
+/**
+ * @name   Size cache double free unit test
+ * @brief  Tests that freeing a cached block again does not hand it out twice.
+ */
+START_TEST (test_size_cache_double_free)
+{
+  volatile size_t size = 32;
+  void *ptr1 = MALLOC(size);
+  void *ptr2, *ptr3;
+
+  FREE(ptr1);
+  FREE(ptr1);
+  ptr2 = MALLOC(32);
+  ptr3 = MALLOC(size);
+  ck_assert(ptr2 == ptr1);
+  ck_assert(ptr3 != ptr2);
+  FREE(ptr3);
+  FREE(ptr2);
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+#endif
+
+#ifdef MM_GROWABLE
+/**
+ * @name   Heap growth unit test
+ * @brief  Tests that allocations beyond the initial heap extend it.
+ */
+START_TEST (test_heap_growth)
+{
+  size_t size = 24 * 1024 * 1024;
+  uintptr_t end = memory_end;
+  char *ptrs[3];
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    ptrs[i] = MALLOC(size);
+    ck_assert(ptrs[i] != NULL);
+    ptrs[i][0] = ptrs[i][size - 1] = (char) i;
+  }
+  ck_assert(memory_end > end);
+  ck_assert_int_eq(simple_heap_check(), 0);
+  for (i = 0; i < 3; i++) {
+    ck_assert(ptrs[i][0] == (char) i && ptrs[i][size - 1] == (char) i);
+    FREE(ptrs[i]);
+  }
+  ck_assert_int_eq(simple_heap_check(), 0);
+}
+END_TEST
+#endif
+
+#ifdef MM_PROFILE
+/**
+ * @name   Live bytes reported by the heap profile
+ */
+static unsigned long profile_live_bytes(void)
+{
+  unsigned long live = 0;
+  FILE *out = tmpfile();
+  simple_profile_dump(out);
+  rewind(out);
+  ck_assert(fscanf(out, "Heap profile: %lu live bytes", &live) == 1);
+  fclose(out);
+  return live;
+}
+
+/**
+ * @name   Heap profiler unit test
+ * @brief  Tests that a large block is sampled while live and removed when freed.
+ */
+START_TEST (test_heap_profile)
+{
+  simple_profile_set_interval(64 * 1024);
+  unsigned long before = profile_live_bytes();
+  void *ptr = MALLOC(2 * 1024 * 1024);   /* 32 intervals, sampled all but surely */
+
+  ck_assert(profile_live_bytes() >= before + 2 * 1024 * 1024);
+  FREE(ptr);
+  ck_assert(profile_live_bytes() == before);
+  simple_profile_set_interval(0);
+}
+END_TEST
+
+/**
+ * @name   Heap profiler estimate unit test
+ * @brief  Tests that blocks the size of the sampling interval are not under counted.
+ */
+START_TEST (test_heap_profile_estimate)
+{
+  static void *ptrs[4000];
+  unsigned long real = 4000 * 4096, live;
+  int i;
+
+  simple_profile_set_interval(4096);
+  unsigned long before = profile_live_bytes();
+  for (i = 0; i < 4000; i++) {
+    ptrs[i] = MALLOC(4096);
+    ck_assert(ptrs[i] != NULL);
+  }
+  live = profile_live_bytes() - before;
+  ck_assert_msg(live > real * 9 / 10 && live < real * 11 / 10,
+                "Estimated %lu live bytes for %lu\n", live, real);
+  for (i = 0; i < 4000; i++) FREE(ptrs[i]);
+  ck_assert(profile_live_bytes() == before);
+  simple_profile_set_interval(0);
+}
+END_TEST
+#endif
+
+#ifdef MM_DEBUG
+/**
+ * @name   Guard word unit test
+ * @brief  Tests that a write past the end of a payload is detected.
+ */
+START_TEST (test_heap_check_overrun)
+{
+  uint8_t *ptr = MALLOC(16);
+  uint8_t saved = ptr[16];
+
+  ptr[16] ^= 0xFF;
+  ck_assert_int_ne(simple_heap_check(), 0);
+  ptr[16] = saved;
+  ck_assert_int_eq(simple_heap_check(), 0);
+  FREE(ptr);
+}
+END_TEST
+#endif
+
 /**
  * { You may provide more unit tests here, but remember to add them to simple_malloc_suite }
  */
@@ -290,9 +626,31 @@ Suite* simple_malloc_suite()
   Suite *s = suite_create("simple_malloc");
   TCase *tc_core = tcase_create("Core tests");
   tcase_set_timeout(tc_core, 120);
+#if defined(MM_WILDERNESS) && !defined(MM_PERSISTENT)
+  tcase_add_test (tc_core, test_wilderness);
+  tcase_add_test (tc_core, test_wilderness_run);
+#endif
   tcase_add_test (tc_core, test_simple_allocation);
   tcase_add_test (tc_core, test_simple_unique_addresses);
   tcase_add_test (tc_core, test_memory_exerciser);
+  tcase_add_test (tc_core, test_heap_check);
+  tcase_add_test (tc_core, test_fit_policy);
+  tcase_add_test (tc_core, test_heap_export);
+  tcase_add_test (tc_core, test_roots);
+#ifdef MM_SIZE_CACHE
+  tcase_add_test (tc_core, test_size_cache);
+  tcase_add_test (tc_core, test_size_cache_double_free);
+#endif
+#ifdef MM_GROWABLE
+  tcase_add_test (tc_core, test_heap_growth);
+#endif
+#ifdef MM_PROFILE
+  tcase_add_test (tc_core, test_heap_profile);
+  tcase_add_test (tc_core, test_heap_profile_estimate);
+#endif
+#ifdef MM_DEBUG
+  tcase_add_test (tc_core, test_heap_check_overrun);
+#endif
 
   suite_add_tcase(s, tc_core);
   return s;
@@ -0,0 +1,168 @@
+/**
+ * @file   heap_frag.c
+ * @brief  Fragmentation report for heap snapshots written by simple_heap_export.
+ *
+ * Usage: heap_frag <snapshot>
+ *
+ * Reads either export format, merges adjacent free blocks into holes and
+ * prints a summary together with a histogram of hole sizes in power of
+ * two buckets.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "mm.h"
+
+#define BUCKETS    64
+#define BAR_WIDTH  50
+
+/* Totals collected while reading a snapshot */
+struct report {
+  uint64_t heap_size;
+  uint64_t allocated_bytes;
+  uint64_t allocated_blocks;
+  uint64_t free_bytes;
+  uint64_t wilderness_bytes;      // Untouched tail of the heap, part of free_bytes
+  uint64_t cached_bytes;          // Blocks held in size class caches, part of free_bytes
+  uint64_t holes;
+  uint64_t largest_hole;
+  uint64_t hole_count[BUCKETS];
+  uint64_t hole_bytes[BUCKETS];
+  uint64_t open_hole;             // Size of the hole being collected, 0 if none
+};
+
+/**
+ * @name  bucket
+ * @brief Index of the power of two bucket holding size
+ */
+static int bucket(uint64_t size) {
+  int b = 0;
+  while (size > 1 && b < BUCKETS - 1) {
+    size >>= 1;
+    b++;
+  }
+  return b;
+}
+
+/**
+ * @name  close_hole
+ * @brief Account for the hole being collected, if any
+ */
+static void close_hole(struct report *r) {
+  if (r->open_hole == 0) return;
+  int b = bucket(r->open_hole);
+  r->holes++;
+  r->hole_count[b]++;
+  r->hole_bytes[b] += r->open_hole;
+  if (r->open_hole > r->largest_hole) r->largest_hole = r->open_hole;
+  r->open_hole = 0;
+}
+
+/**
+ * @name  add_run
+ * @brief Account for size bytes in blocks blocks of the given state
+ */
+static void add_run(struct report *r, uint64_t size, uint64_t blocks, int free) {
+  if (free) {
+    if (free == 2) r->wilderness_bytes += size;
+    if (free == 3) r->cached_bytes += size;
+    r->free_bytes += size;
+    r->open_hole += size;
+  } else {
+    close_hole(r);
+    r->allocated_bytes += size;
+    r->allocated_blocks += blocks;
+  }
+}
+
+/**
+ * @name  read_binary
+ * @brief Read a snapshot in SIMPLE_EXPORT_BINARY format
+ */
+static int read_binary(FILE *in, struct report *r) {
+  SimpleExportHeader header;
+  SimpleExportRun run;
+
+  if (fread(&header, sizeof(header), 1, in) != 1) return 1;
+  r->heap_size = header.heap_size;
+  while (fread(&run, sizeof(run), 1, in) == 1) {
+    add_run(r, run.size, run.blocks, run.free);
+  }
+  return ferror(in) ? 1 : 0;
+}
+
+/**
+ * @name  read_csv
+ * @brief Read a snapshot in SIMPLE_EXPORT_CSV format
+ */
+static int read_csv(FILE *in, struct report *r) {
+  char line[128];
+  unsigned long offset, size;
+  int free;
+
+  if (fgets(line, sizeof(line), in) == NULL) return 1;  // Column names
+  while (fscanf(in, "%lu,%lu,%d", &offset, &size, &free) == 3) {
+    add_run(r, size, 1, free);
+    r->heap_size = offset + size;
+  }
+  return ferror(in) ? 1 : 0;
+}
+
+int main(int argc, char ** argv) {
+  struct report r;
+  char magic[sizeof(SIMPLE_EXPORT_MAGIC)];
+  FILE *in;
+  int ret;
+  int b;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <snapshot>\n", argv[0]);
+    return 1;
+  }
+  in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  memset(&r, 0, sizeof(r));
+  if (fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, SIMPLE_EXPORT_MAGIC, sizeof(magic)) == 0) {
+    rewind(in);
+    ret = read_binary(in, &r);
+  } else {
+    rewind(in);
+    ret = read_csv(in, &r);
+  }
+  fclose(in);
+  if (ret != 0) {
+    fprintf(stderr, "%s: not a heap snapshot\n", argv[1]);
+    return 1;
+  }
+  close_hole(&r);
+
+  printf("heap size        %lu bytes\n", r.heap_size);
+  printf("allocated        %lu bytes in %lu blocks\n", r.allocated_bytes, r.allocated_blocks);
+  printf("free             %lu bytes in %lu holes\n", r.free_bytes, r.holes);
+  printf("wilderness       %lu bytes\n", r.wilderness_bytes);
+  printf("cached           %lu bytes\n", r.cached_bytes);
+  printf("largest hole     %lu bytes\n", r.largest_hole);
+  printf("fragmentation    %.1f%%\n",
+         r.free_bytes ? 100.0 * (1.0 - (double) r.largest_hole / r.free_bytes) : 0.0);
+  printf("\n%-22s %10s %14s\n", "hole size", "holes", "bytes");
+
+  uint64_t max_bytes = 0;
+  for (b = 0; b < BUCKETS; b++) {
+    if (r.hole_bytes[b] > max_bytes) max_bytes = r.hole_bytes[b];
+  }
+  for (b = 0; b < BUCKETS; b++) {
+    if (r.hole_count[b] == 0) continue;
+    char range[32];
+    snprintf(range, sizeof(range), "[2^%d, 2^%d)", b, b + 1);
+    printf("%-22s %10lu %14lu ", range, r.hole_count[b], r.hole_bytes[b]);
+    for (int i = 0; i < (int) (BAR_WIDTH * r.hole_bytes[b] / max_bytes); i++) putchar('#');
+    putchar('\n');
+  }
+  return 0;
+}
@@ -5,22 +5,47 @@
 #include <unistd.h>
 #include <errno.h>
 
+#define IO_CHUNK_SIZE 4096 // Bytes moved per read/write system call
+
+static char in_buffer[IO_CHUNK_SIZE];
+static ssize_t in_length = 0;
+static ssize_t in_position = 0;
+
+static char out_buffer[IO_CHUNK_SIZE];
+static ssize_t out_length = 0;
+
 int read_char() {
-  ssize_t result;
-  char c;
-  result = read(STDIN_FILENO, &c, 1);
-  if (result == 1) {
-    return (int)c;
+  if (in_position == in_length) {
+    ssize_t result = read(STDIN_FILENO, in_buffer, IO_CHUNK_SIZE);
+    if (result <= 0) {
+      return EOF;
+    }
+    in_length = result;
+    in_position = 0;
   }
-  return EOF;
+  return (int)in_buffer[in_position++];
+}
+
+int flush_output() {
+  ssize_t written = 0;
+  while (written < out_length) {
+    ssize_t result = write(STDOUT_FILENO, out_buffer + written, out_length - written);
+    if (result <= 0) {
+      out_length = 0;
+      return EOF;
+    }
+    written += result;
+  }
+  out_length = 0;
+  return 0;
 }
 
 int write_char(char c) {
-  ssize_t result = write(STDOUT_FILENO, &c, 1);
-  if (result == 1) {
-    return 0;
+  if (out_length == IO_CHUNK_SIZE && flush_output() == EOF) {
+    return EOF;
   }
-  return EOF;
+  out_buffer[out_length++] = c;
+  return 0;
 }
 
 int write_string(char* s) {
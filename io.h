@@ -13,10 +13,16 @@
 extern int
 read_char();
 
-/* Writes a character to stdout.  If no errors occur, it returns 0, otherwise EOF */
+/* Writes a character to stdout.  If no errors occur, it returns 0, otherwise EOF.
+ * Output is buffered in chunks; call flush_output() before exiting.
+ */
 extern int
 write_char(char c);
 
+/* Writes any buffered output to stdout.  If no errors occur, it returns 0, otherwise EOF */
+extern int
+flush_output();
+
 /* Writes a null-terminated string to stdout.  If no errors occur, it returns 0, otherwise EOF */
 extern int
 write_string(char* s);
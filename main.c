@@ -25,6 +25,7 @@ int main(int argc, char ** argv) {
   display_list(collection);
   free_list(collection);
   write_char('\n'); 
+  flush_output();
 
   return 0;
 }
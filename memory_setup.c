@@ -9,13 +9,157 @@
  *
  */
 
+#if defined(MM_PERSISTENT) && defined(MM_GROWABLE)
+#error "A persistent heap has the fixed size of its file, MM_GROWABLE is not supported"
+#endif
+
+#if defined(MM_PERSISTENT) || defined(MM_HUGE_PAGES) || defined(MM_GROWABLE)
+#define _DEFAULT_SOURCE                               // For mmap flags, madvise and ftruncate
+#include <sys/mman.h>
+#endif
+#ifdef MM_PERSISTENT
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef MM_GROWABLE
+#include <stdlib.h>
+#endif
 #include "mm.h"
 
+#ifndef ALLOCATE_SIZE
 #define ALLOCATE_SIZE    32*1024*1024                 // 32 MB
+#endif
 #define SKEW_SIZE        10
+#define HUGE_PAGE_SIZE   (2*1024*1024)                // 2 MB
+#define DEFAULT_RESERVE  (1ULL << 40)                 // 1 TB of address space for a growable heap
+
+#if defined(MM_PERSISTENT)
+#define PERSISTENT_BASE  0x200000000000ULL            // Fixed address of the mapped heap file
+#define DEFAULT_HEAP_FILE "simple_heap.img"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* The header page comes first in the file, the managed memory follows it */
+const uintptr_t memory_start =  PERSISTENT_BASE + SIMPLE_PERSISTENT_HEADER_SIZE;
+const uintptr_t memory_end   =  PERSISTENT_BASE + SIMPLE_PERSISTENT_HEADER_SIZE + ALLOCATE_SIZE;
+
+/**
+ * @name    memory_map_persistent
+ * @brief   Maps the heap file named by SIMPLE_HEAP_FILE at PERSISTENT_BASE.
+ *          A file of the wrong size is recreated filled with zeros. The file
+ *          stays locked while the process runs, so a second process using
+ *          the same file fails here instead of changing the blocks concurrently.
+ * @retval  Pointer to the header page or NULL; *created is set for a new file
+ */
+void * memory_map_persistent(int * created) {
+  const char * path = getenv("SIMPLE_HEAP_FILE");
+  size_t length = memory_end - PERSISTENT_BASE;
+  struct stat st;
+  void * base;
+  int fd;
+
+  if (path == NULL) path = DEFAULT_HEAP_FILE;
+  fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) return NULL;
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  *created = (size_t) st.st_size != length;
+  if (*created && (ftruncate(fd, 0) != 0 || ftruncate(fd, length) != 0)) {
+    close(fd);
+    return NULL;
+  }
 
+  base = mmap((void *) PERSISTENT_BASE, length, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+  if (base != MAP_FAILED && base != (void *) PERSISTENT_BASE) {   // Kernels without MAP_FIXED_NOREPLACE treat it as a hint
+    munmap(base, length);
+    base = MAP_FAILED;
+  }
+  if (base == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  return base;                                   // fd stays open and holds the lock until exit
+}
+#elif defined(MM_GROWABLE)
+/* Set by memory_reserve, memory_end moves up as memory_grow commits more of the reservation */
+uintptr_t memory_start = 0;
+uintptr_t memory_end   = 0;
+static uintptr_t reserve_end = 0;
+
+/**
+ * @name    memory_reserve
+ * @brief   Reserves SIMPLE_HEAP_RESERVE bytes of address space (default 1 TB)
+ *          without backing it and makes the first ALLOCATE_SIZE bytes usable.
+ * @retval  0 on success, also if the heap is already reserved, otherwise 1
+ */
+int memory_reserve(void) {
+  const char * env = getenv("SIMPLE_HEAP_RESERVE");
+  size_t reserve = env != NULL && strtoull(env, NULL, 0) > 0 ? strtoull(env, NULL, 0) : DEFAULT_RESERVE;
+  void * base;
+
+  if (memory_start != 0) return 0;
+  reserve = (reserve + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+  if (reserve < ALLOCATE_SIZE) reserve = ALLOCATE_SIZE;
+  base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) return 1;
+  if (mprotect(base, ALLOCATE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+    munmap(base, reserve);
+    return 1;
+  }
+#ifdef MM_HUGE_PAGES
+  madvise(base, reserve, MADV_HUGEPAGE);
+#endif
+  memory_start = (uintptr_t) base;
+  memory_end   = (uintptr_t) base + ALLOCATE_SIZE;
+  reserve_end  = (uintptr_t) base + reserve;
+  return 0;
+}
+
+/**
+ * @name    memory_grow
+ * @brief   Makes at least bytes more memory usable at memory_end. The heap at
+ *          least doubles, so a growing heap is extended a logarithmic number of times.
+ * @retval  0 on success, 1 if the reservation is used up
+ */
+int memory_grow(size_t bytes) {
+  size_t grow = memory_end - memory_start;
+  size_t available = reserve_end - memory_end;
+
+  if (grow < bytes) grow = bytes;
+  grow = (grow + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+  if (grow > available) grow = available;
+  if (grow < bytes) return 1;
+  if (mprotect((void *) memory_end, grow, PROT_READ | PROT_WRITE) != 0) return 1;
+  memory_end += grow;
+  return 0;
+}
+#elif defined(MM_HUGE_PAGES)
+/* Heap aligned to huge pages so the kernel can back it with transparent huge pages */
+static int8_t memory[ALLOCATE_SIZE] __attribute__((aligned(HUGE_PAGE_SIZE)));
+
+/**
+ * @name    request_huge_pages
+ * @brief   Ask for transparent huge pages before the heap is touched.
+ *          If they are not available the heap simply stays on normal pages.
+ */
+__attribute__((constructor))
+static void request_huge_pages(void) {
+  madvise(memory, ALLOCATE_SIZE, MADV_HUGEPAGE);
+}
+#else
 static int8_t skew[SKEW_SIZE];                        // Misalignment
 static int8_t memory[ALLOCATE_SIZE];
+#endif
 
+#if !defined(MM_PERSISTENT) && !defined(MM_GROWABLE)
 const uintptr_t memory_start =  (uintptr_t) memory;
 const uintptr_t memory_end   =  (uintptr_t) memory + ALLOCATE_SIZE;
+#endif
@@ -7,7 +7,14 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "mm.h"
+#ifdef MM_PROFILE
+#include "mm_profile.h"
+#endif
+
+#undef simple_malloc    // This file defines the out-of-line allocator
 
 // Define the block header structure for circular linked list
 typedef struct header {
@@ -18,14 +25,26 @@ typedef struct header {
 static BlockHeader * first = NULL;
 static BlockHeader * current = NULL;
 static BlockHeader * last = NULL;
+static BlockHeader * top = NULL;      // Wilderness block, only used with MM_WILDERNESS
+static size_t free_blocks = 0;        // Blocks with the free flag set
+
+#ifdef MM_SIZE_CACHE
+void * simple_cache_head[SIMPLE_CACHE_CLASSES];
+unsigned simple_cache_count[SIMPLE_CACHE_CLASSES];
+#endif
+
+static void * volatile_roots[SIMPLE_ROOTS];
+static void ** roots = volatile_roots;
 
-/* Macros to handle the free flag at bit 0 of the next pointer of header pointed at by p */
-#define GET_NEXT(p)    (BlockHeader *) ((uintptr_t) (p->next) & ~FREE_FLAG_MASK)
+/* Macros to handle the free flag at bit 0 and the cached flag at bit 2 of the next pointer of header pointed at by p */
+#define FLAG_MASK      (FREE_FLAG_MASK | CACHED_FLAG_MASK)
+#define GET_NEXT(p)    (BlockHeader *) ((uintptr_t) (p->next) & ~FLAG_MASK)
 #define SET_NEXT(p,n)  do{ \
   uintptr_t current_val = (uintptr_t)((p)->next); \
   uintptr_t free_flag = current_val & FREE_FLAG_MASK; \
   (p)->next = (BlockHeader *) ((uintptr_t) (n) | free_flag); \
-}while(0)
+}while(0)   /* Cached blocks are never relinked, so the cached flag is dropped */
+#define GET_CACHED(p)  (uint8_t) ( ((uintptr_t) (p->next) & CACHED_FLAG_MASK) != 0 )
 #define GET_FREE(p)    (uint8_t) ( (uintptr_t) (p->next) & 0x1 )
 #define SET_FREE(p,f)  do{ \
   uintptr_t current_val = (uintptr_t)(p->next); \
@@ -36,6 +55,17 @@ static BlockHeader * last = NULL;
 #define SIZE(p) ((uintptr_t)GET_NEXT(p) - (uintptr_t)p - sizeof(BlockHeader))
 #define MIN_SIZE     (8) 
 
+#ifdef MM_DEBUG
+/* Guard words placed before and after each payload in debug builds */
+#define CANARY_FRONT 0xFEEDFACECAFEBEEFULL  // XOR'ed with the payload size
+#define CANARY_BACK  0xDEADC0DEBAADF00DULL
+#define GUARD_SIZE   (2 * sizeof(uint64_t))
+#define GUARD_WORDS  1                      // Words between header and payload
+#else
+#define GUARD_SIZE   0
+#define GUARD_WORDS  0
+#endif
+
 /**
  * @name  find_previous_block
  * @brief Find the block header for the previous block in the list
@@ -60,35 +90,349 @@ static BlockHeader * last = NULL;
   return NULL;  // Block not found in the list
 }*/
 
+#ifdef MM_DEBUG
+/**
+ * @name  set_guards
+ * @brief Write the guard words around a payload of the given aligned size
+ */
+static void set_guards(BlockHeader *block, size_t payload_size){
+  block->user_block[0] = CANARY_FRONT ^ payload_size;
+  block->user_block[1 + payload_size / sizeof(uint64_t)] = CANARY_BACK;
+}
+
+/**
+ * @name  check_guards
+ * @brief Verify the guard words of an allocated block
+ * @retval 0 if both guards are intact, otherwise 1
+ */
+static int check_guards(BlockHeader *block){
+  size_t payload_size = block->user_block[0] ^ CANARY_FRONT;
+  if (payload_size + GUARD_SIZE > SIZE(block)) return 1;  // Front guard damaged
+  if (block->user_block[1 + payload_size / sizeof(uint64_t)] != CANARY_BACK) return 1;
+  return 0;
+}
+#endif
+
+#ifdef MM_SIDE_TABLE
+/*
+ * Out-of-band block table. Every MIN_SIZE granule of the heap has one bit in
+ * start_bits (a block header begins here) and one in free_bits (a free block
+ * begins here). Bit w of summary_bits is set when free_bits[w] is not zero,
+ * so a search for free blocks reads one bit per 4096 granules of heap
+ * instead of one header per block. The table lives in the memory above the
+ * last block, which starts out zeroed.
+ */
+#define WORD_BITS   64
+#define NO_GRANULE  ((size_t) -1)
+
+static uint64_t * start_bits = NULL;
+static uint64_t * free_bits = NULL;
+static uint64_t * summary_bits = NULL;
+static size_t table_words = 0;              // Words in start_bits and free_bits
+
+#define GRANULE(p)        (((uintptr_t) (p) - (uintptr_t) first) / MIN_SIZE)
+#define BLOCK_AT(g)       ((BlockHeader *) ((uintptr_t) first + (g) * MIN_SIZE))
+#define TABLE_WORDS(heap) (((heap) / MIN_SIZE + WORD_BITS - 1) / WORD_BITS)
+#define TABLE_BYTES(heap) ((2 * TABLE_WORDS(heap) + (TABLE_WORDS(heap) + WORD_BITS - 1) / WORD_BITS) * sizeof(uint64_t))
+
+/**
+ * @name  table_mark
+ * @brief Record that a block with the given free state starts at block
+ */
+static void table_mark(BlockHeader *block, int free){
+  size_t g = GRANULE(block);
+  size_t w = g / WORD_BITS;
+  uint64_t bit = 1ULL << (g % WORD_BITS);
+  start_bits[w] |= bit;
+  if (free) free_bits[w] |= bit; else free_bits[w] &= ~bit;
+  if (free_bits[w]) summary_bits[w / WORD_BITS] |= 1ULL << (w % WORD_BITS);
+  else summary_bits[w / WORD_BITS] &= ~(1ULL << (w % WORD_BITS));
+}
+
+/**
+ * @name  table_clear
+ * @brief Record that block has been merged into its predecessor
+ */
+static void table_clear(BlockHeader *block){
+  size_t g = GRANULE(block);
+  size_t w = g / WORD_BITS;
+  uint64_t bit = 1ULL << (g % WORD_BITS);
+  start_bits[w] &= ~bit;
+  free_bits[w] &= ~bit;
+  if (free_bits[w] == 0) summary_bits[w / WORD_BITS] &= ~(1ULL << (w % WORD_BITS));
+}
+
+/**
+ * @name  table_next_free
+ * @brief Find the first free block starting at granule g or later, before granule end
+ * @retval The granule of that block or NO_GRANULE
+ */
+static size_t table_next_free(size_t g, size_t end){
+  size_t summary_words = (table_words + WORD_BITS - 1) / WORD_BITS;
+  if (g >= end) return NO_GRANULE;
+  size_t w = g / WORD_BITS;
+  uint64_t bits = free_bits[w] & (~0ULL << (g % WORD_BITS));
+  while (bits == 0) {
+    /* Skip words without free blocks using the summary */
+    size_t s = (w + 1) / WORD_BITS;
+    if (s >= summary_words) return NO_GRANULE;
+    uint64_t summary = summary_bits[s] & (~0ULL << ((w + 1) % WORD_BITS));
+    while (summary == 0) {
+      if (++s >= summary_words) return NO_GRANULE;
+      summary = summary_bits[s];
+    }
+    w = s * WORD_BITS + __builtin_ctzll(summary);
+    bits = free_bits[w];
+  }
+  g = w * WORD_BITS + __builtin_ctzll(bits);
+  return g < end ? g : NO_GRANULE;
+}
+
+
+/**
+ * @name  table_attach
+ * @brief Point the table at the memory just above the last block
+ */
+static void table_attach(void){
+  uintptr_t heap_end = (uintptr_t) last + sizeof(BlockHeader);
+  table_words  = TABLE_WORDS(heap_end - (uintptr_t) first);
+  start_bits   = (uint64_t *) heap_end;
+  free_bits    = start_bits + table_words;
+  summary_bits = free_bits + table_words;
+}
+
+#define TABLE_MARK(p,f)  table_mark(p,f)
+#define TABLE_CLEAR(p)   table_clear(p)
+#else
+#define TABLE_MARK(p,f)
+#define TABLE_CLEAR(p)
+#endif
+
+#ifdef MM_WILDERNESS
+static int absorb_into_top(BlockHeader *block);
+#endif
+
 /**
  * @name  coalesce_free_blocks
- * @brief Merge adjacent free blocks to reduce fragmentation
+ * @brief Merge block with the free blocks that follow it to reduce fragmentation.
+ *        If the roving pointer was merged away it is moved back to block.
  */
 static void coalesce_free_blocks(BlockHeader *block){
   if(block == NULL || GET_FREE(block) == 0 || block == last) return;  
-  uint16_t flag = GET_FREE(block);
   BlockHeader * next_block = GET_NEXT(block);
-  if(next_block != last && GET_FREE(next_block) == 1){
+  while(next_block != last && GET_FREE(next_block) == 1){
     SET_NEXT(block, GET_NEXT(next_block));
+    TABLE_CLEAR(next_block);
+    free_blocks--;
+    if (current == next_block) current = block;
+    next_block = GET_NEXT(block);
+  }
+#ifdef MM_WILDERNESS
+  absorb_into_top(block);   // A free run that ends at the wilderness goes back to it
+#endif
+}
+
+
+#ifdef MM_PERSISTENT
+#define PERSISTENT_MAGIC   0x5041454850504d53ULL   // "SMPPHEAP"
+#define PERSISTENT_VERSION 2                      // Raise whenever PersistentHeader or the block format changes
+
+/* Build options that change the heap layout; a file written with others is not reused */
+#ifdef MM_DEBUG
+#define LAYOUT_DEBUG 0x1
+#else
+#define LAYOUT_DEBUG 0x0
+#endif
+#ifdef MM_SIDE_TABLE
+#define LAYOUT_TABLE 0x2
+#else
+#define LAYOUT_TABLE 0x0
+#endif
+#ifdef MM_WILDERNESS
+#define LAYOUT_WILDERNESS 0x4
+#else
+#define LAYOUT_WILDERNESS 0x0
+#endif
+#define PERSISTENT_LAYOUT  (PERSISTENT_VERSION << 8 | LAYOUT_DEBUG | LAYOUT_TABLE | LAYOUT_WILDERNESS)
+
+/* Stored in the header page of the heap file */
+typedef struct {
+  uint64_t      magic;
+  uint64_t      layout;                 // PERSISTENT_LAYOUT of the writer
+  uintptr_t     memory_start;
+  uintptr_t     memory_end;
+  BlockHeader * first;
+  BlockHeader * last;
+  BlockHeader * top;
+  void *        roots[SIMPLE_ROOTS];
+} PersistentHeader;
+
+static PersistentHeader * persistent = NULL;
+static int persistent_failed = 0;        // Mapping the file failed, the heap stays empty
+
+/**
+ * @name  persistent_attach
+ * @brief Map the heap file and reuse the heap in it if the block list validates
+ * @retval 1 if simple_init is done (heap reattached or file unusable), 0 to build a new heap
+ */
+static int persistent_attach(void) {
+  int created = 0;
+
+  if (persistent_failed) return 1;       // Reported once, not retried on every call
+  if (persistent == NULL) {
+    persistent = (PersistentHeader *) memory_map_persistent(&created);
+    if (persistent == NULL) {
+      fprintf(stderr, "simple_init: cannot map the persistent heap file (or it is in use)\n");
+      persistent_failed = 1;
+      return 1;
+    }
+    roots = persistent->roots;
+  }
+  if (created || persistent->magic != PERSISTENT_MAGIC || persistent->layout != PERSISTENT_LAYOUT ||
+      persistent->memory_start != memory_start || persistent->memory_end != memory_end) {
+    memset(persistent, 0, sizeof(PersistentHeader));
+    return 0;
+  }
+
+  first = persistent->first;
+  last = persistent->last;
+  top = persistent->top;
+  current = first;
+  if ((uintptr_t) first < memory_start || (uintptr_t) last >= memory_end || first >= last) {
+    first = last = current = top = NULL;
+    memset(persistent, 0, sizeof(PersistentHeader));
+    return 0;
+  }
+#ifdef MM_SIDE_TABLE
+  table_attach();
+#endif
+  /* Count the free blocks; a damaged list stops the count and fails the check below */
+  free_blocks = 0;
+  for (BlockHeader * p = first; p < last && GET_NEXT(p) > p; p = GET_NEXT(p)) {
+    free_blocks += GET_FREE(p);
   }
+  if (simple_heap_check() != 0) {
+    fprintf(stderr, "simple_init: persistent heap is damaged, starting with an empty heap\n");
+    first = last = current = top = NULL;
+    memset(persistent, 0, sizeof(PersistentHeader));
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * @name  persistent_store
+ * @brief Record a newly built heap in the header page
+ */
+static void persistent_store(void) {
+  persistent->memory_start = memory_start;
+  persistent->memory_end = memory_end;
+  persistent->first = first;
+  persistent->last = last;
+  persistent->top = top;
+  persistent->layout = PERSISTENT_LAYOUT;
+  persistent->magic = PERSISTENT_MAGIC;   // Written last, marks the header as complete
 }
+#endif
 
+#ifdef MM_WILDERNESS
+/**
+ * @name  set_top
+ * @brief Make block the wilderness block (NULL once it is used up)
+ */
+static void set_top(BlockHeader *block){
+  top = block;
+#ifdef MM_PERSISTENT
+  persistent->top = block;
+#endif
+}
+
+/**
+ * @name  absorb_into_top
+ * @brief Return block to the wilderness if it is free and ends at it (or at the end of the heap)
+ * @retval 1 if block is now the wilderness block, otherwise 0
+ */
+static int absorb_into_top(BlockHeader *block){
+  BlockHeader * next_block = GET_NEXT(block);
+  if (GET_FREE(block) == 0 || !(next_block == top || (top == NULL && next_block == last))) return 0;
+  if (next_block == top) {
+    SET_NEXT(block, GET_NEXT(top));
+    TABLE_CLEAR(top);
+    if (current == top) current = block;
+  }
+  SET_FREE(block, 0);
+  TABLE_MARK(block, 0);
+  free_blocks--;
+  set_top(block);
+  return 1;
+}
+
+/**
+ * @name  free_run_before_top
+ * @brief Find the first block of the run of free blocks that ends at the wilderness
+ *        (or at the end of the heap once the wilderness is used up)
+ * @retval That block, or NULL if the block before the wilderness is not free
+ */
+static BlockHeader * free_run_before_top(void){
+  BlockHeader * end = top != NULL ? top : last;
+  BlockHeader * run = NULL;
+#ifdef MM_SIDE_TABLE
+  /* Step back over the start bits of the blocks before end */
+  size_t g = GRANULE(end);
+  while (g > 0) {
+    size_t w = --g / WORD_BITS;
+    uint64_t bits = start_bits[w] & (~0ULL >> (WORD_BITS - 1 - g % WORD_BITS));
+    while (bits == 0 && w > 0) bits = start_bits[--w];
+    if (bits == 0) break;
+    g = w * WORD_BITS + WORD_BITS - 1 - __builtin_clzll(bits);
+    if (GET_FREE(BLOCK_AT(g)) == 0) break;
+    run = BLOCK_AT(g);
+  }
+#else
+  /* The list has no back links, walk it from the start */
+  for (BlockHeader * p = first; p != end; p = GET_NEXT(p)) {
+    if (GET_FREE(p) == 0) run = NULL;
+    else if (run == NULL) run = p;
+  }
+#endif
+  return run;
+}
+#endif
 
 /**
  * @name    simple_init
  * @brief   Initialize the block structure within the available memory
  */
 void simple_init() {
+#ifdef MM_GROWABLE
+  if (memory_reserve() != 0) return;
+#endif
   uintptr_t aligned_memory_start = (memory_start + MIN_SIZE-1) & ~(MIN_SIZE-1);
   uintptr_t aligned_memory_end   = (memory_end & ~(MIN_SIZE-1));
+#ifdef MM_SIDE_TABLE
+  /* Keep room for the table above the last block */
+  size_t table_bytes = TABLE_BYTES(aligned_memory_end - aligned_memory_start);
+  if (aligned_memory_start + table_bytes >= aligned_memory_end) return;
+  aligned_memory_end -= table_bytes;
+#endif
     
   if (first == NULL) {
+#ifdef MM_PERSISTENT
+    if (persistent_attach()) return;
+#endif
     if (aligned_memory_start + 3 * sizeof(BlockHeader) + MIN_SIZE <= aligned_memory_end) {
       size_t available_space = aligned_memory_end - aligned_memory_start;
       size_t first_block_size = available_space - 3 * sizeof(BlockHeader);
       
       first = (BlockHeader *) aligned_memory_start;
       last = (BlockHeader *)(aligned_memory_end - sizeof(BlockHeader));
+#ifdef MM_WILDERNESS
+      /* All memory starts out in the wilderness block, which is not on the free list */
+      SET_NEXT(first, last);
+      SET_FREE(first, 0);
+      top = first;
+      free_blocks = 0;
+#else
       current = (BlockHeader *) (aligned_memory_end -  2 * sizeof(BlockHeader));
 
       SET_NEXT(first, current);
@@ -96,64 +440,243 @@ void simple_init() {
       
       SET_NEXT(current, last);
       SET_FREE(current, 1);  // Dummy is ALLOCATED (never free)
+      free_blocks = 2;
+#endif
       
       SET_NEXT(last, first);
       SET_FREE(last, 0);   // Last block is ALLOCATED (never free)
+
+#ifdef MM_SIDE_TABLE
+      table_attach();
+#ifdef MM_PERSISTENT
+      memset(start_bits, 0, table_bytes);   // The file may hold an old heap
+#endif
+      TABLE_MARK(first, GET_FREE(first));
+#ifndef MM_WILDERNESS
+      TABLE_MARK(current, 1);
+#endif
+      TABLE_MARK(last, 0);
+#endif
     }
     SET_NEXT(last, first);     
     current = first;
+#ifdef MM_PERSISTENT
+    persistent_store();
+#endif
+  }
+}
+
+#ifdef MM_SIDE_TABLE
+/**
+ * @name    find_free_block
+ * @brief   Find a free block of at least size bytes, starting at current,
+ *          by scanning the free bits of the side table
+ */
+static BlockHeader * find_free_block(size_t size) {
+  size_t start = GRANULE(current);
+  size_t end = GRANULE(last);
+  size_t g = start;
+  int wrapped = 0;
+
+  for (;;) {
+    g = table_next_free(g, wrapped ? start : end);
+    if (g == NO_GRANULE) {
+      if (wrapped || start == 0) return NULL;
+      wrapped = 1;
+      g = 0;
+      continue;
+    }
+    BlockHeader * block = BLOCK_AT(g);
+    coalesce_free_blocks(block);           // May return block to the wilderness
+    if (GET_FREE(block) == 1 && SIZE(block) >= size) return block;
+    g++;
+  }
+}
+#else
+/**
+ * @name    find_free_block
+ * @brief   Find a free block of at least size bytes, starting at current,
+ *          by walking the block list
+ */
+static BlockHeader * find_free_block(size_t size) {
+  BlockHeader * search_start = current;
+  BlockHeader * block = current;
+  do {     
+    if (GET_FREE(block) == 1) {
+      coalesce_free_blocks(block);         // May return block to the wilderness
+      if (GET_FREE(block) == 1 && SIZE(block) >= size) return block;
+      if (current != search_start) break;   // The search start was merged into block
+    }    
+    block = GET_NEXT(block);
+  } while (block != search_start);
+  return NULL;
+}
+#endif
+
+#ifdef MM_GROWABLE
+/**
+ * @name    grow_heap
+ * @brief   Extend the heap so that a block of size bytes fits at its end
+ * @retval  The wilderness block, or without MM_WILDERNESS the free block at the
+ *          end of the heap; NULL if the reservation is used up
+ *
+ * The old end sentinel turns into the header of the new memory, a new
+ * sentinel is placed at the new end and the side table moves above it.
+ */
+static BlockHeader * grow_heap(size_t size) {
+  BlockHeader * old_last = last;
+  BlockHeader * new_last;
+  uintptr_t old_end = memory_end;
+  uintptr_t end;
+
+  /* The new sentinel goes past the old table, so the table can be copied up */
+  do {
+    if (memory_grow(size + 2 * sizeof(BlockHeader)) != 0) return NULL;
+    end = memory_end & ~(MIN_SIZE-1);
+#ifdef MM_SIDE_TABLE
+    end -= TABLE_BYTES(end - (uintptr_t) first);
+#endif
+    new_last = (BlockHeader *) (end - sizeof(BlockHeader));
+  } while ((uintptr_t) new_last < old_end ||
+           (uintptr_t) new_last - (uintptr_t) old_last - sizeof(BlockHeader) < size);
+
+  SET_NEXT(new_last, first);
+  SET_FREE(new_last, 0);
+  SET_NEXT(old_last, new_last);
+  last = new_last;
+#ifdef MM_SIDE_TABLE
+  uint64_t * old_start_bits = start_bits;
+  uint64_t * old_free_bits = free_bits;
+  size_t old_words = table_words;
+  table_attach();                        // The new memory above last is still zero
+  memcpy(start_bits, old_start_bits, old_words * sizeof(uint64_t));
+  memcpy(free_bits, old_free_bits, old_words * sizeof(uint64_t));
+  for (size_t w = 0; w < old_words; w++) {
+    if (free_bits[w]) summary_bits[w / WORD_BITS] |= 1ULL << (w % WORD_BITS);
+  }
+  table_mark(new_last, 0);
+#endif
+#ifdef MM_WILDERNESS
+  if (top != NULL) {
+    SET_NEXT(top, new_last);             // The wilderness grows over the old sentinel
+    TABLE_CLEAR(old_last);
+    return top;
+  }
+#endif
+  SET_FREE(old_last, 1);
+  TABLE_MARK(old_last, 1);
+  free_blocks++;
+  coalesce_free_blocks(old_last);        // Becomes the wilderness block in wilderness builds
+#ifdef MM_WILDERNESS
+  return top;
+#else
+  return old_last;
+#endif
+}
+#endif
+
+#ifdef MM_WILDERNESS
+/**
+ * @name    bump_allocate
+ * @brief   Carve a block of size bytes from the front of the wilderness block
+ */
+static BlockHeader * bump_allocate(size_t size) {
+  BlockHeader * block = top;
+#ifdef MM_GROWABLE
+  if (block == NULL || SIZE(block) < size) block = grow_heap(size);
+#endif
+  if (block == NULL || SIZE(block) < size) return NULL;
+  if (SIZE(block) - size >= sizeof(BlockHeader) + MIN_SIZE) {
+    BlockHeader * new_top = (BlockHeader *) ((uintptr_t) block + sizeof(BlockHeader) + size);
+    SET_NEXT(new_top, GET_NEXT(block));
+    SET_FREE(new_top, 0);
+    TABLE_MARK(new_top, 0);
+    SET_NEXT(block, new_top);
+    set_top(new_top);
+  } else {
+    set_top(NULL);             // Too small to keep, hand out all of it
   }
+  return block;
 }
+#endif
 
 /**
  * @name    simple_malloc
  * @brief   Allocate at least size contiguous bytes of memory
  */
 void* simple_malloc(size_t size) {
+#ifdef MM_SIZE_CACHE
+  if (size <= SIMPLE_CACHE_MAX) {
+    void * ptr = simple_cache_pop(SIMPLE_SIZE_CLASS(size));
+    if (ptr != NULL) return ptr;
+  }
+#endif
   if (first == NULL) {
     simple_init();
     if (first == NULL) return NULL;
   }
-  /*if(GET_FREE(first)==1) {
-    current = first;
-  }*/
-  current = first;
+#ifndef MM_NEXT_FIT
+  current = first;   // First fit: every search starts at the beginning of the heap
+#endif
   coalesce_free_blocks(current);
-  size_t aligned_size = ALIGN(size); 
+  size_t payload_size = ALIGN(size);
+  size_t aligned_size = payload_size + GUARD_SIZE;
   if (aligned_size < MIN_SIZE) aligned_size = MIN_SIZE;
-  BlockHeader * search_start = current;
-  int iteration = 0;
-  do {     
-    if (GET_FREE(current) == 1) {
-      coalesce_free_blocks(current);
-      size_t current_size = SIZE(current);      
-      if(current_size >= aligned_size) {        
-        if (current_size - aligned_size >= sizeof(BlockHeader) + MIN_SIZE) {
-          // Split block
-          size_t total_needed = sizeof(BlockHeader) + aligned_size;
-          uintptr_t new_block_addr = (uintptr_t)current + total_needed;
-          new_block_addr = ALIGN(new_block_addr);
-          BlockHeader * new_block = (BlockHeader *) new_block_addr;              
-          SET_NEXT(new_block, GET_NEXT(current));
-          SET_FREE(new_block, 1);
-          SET_NEXT(current, new_block);
-          SET_FREE(current, 0);
-        } else {
-          SET_FREE(current, 0);
-        }
-        void * result = (void*)current->user_block;
-        return result;
-      }else {
-        printf("Block too small: requested %lu, available %lu\n", aligned_size, current_size);
-      }
-    }    
-    current = GET_NEXT(current);
-    iteration++;    
-    if (iteration > 100) {
-      break;
+
+  /* Only a wilderness heap grows with no free block; without MM_WILDERNESS the
+   * untouched tail is a free block until the heap is full, so the search always runs */
+  BlockHeader * block = free_blocks > 0 ? find_free_block(aligned_size) : NULL;
+#if defined(MM_GROWABLE) && !defined(MM_WILDERNESS)
+  if (block == NULL) block = grow_heap(aligned_size);   // bump_allocate grows a wilderness heap
+#endif
+  if (block != NULL) {
+    if (SIZE(block) - aligned_size >= sizeof(BlockHeader) + MIN_SIZE) {
+      // Split block
+      size_t total_needed = sizeof(BlockHeader) + aligned_size;
+      uintptr_t new_block_addr = (uintptr_t)block + total_needed;
+      new_block_addr = ALIGN(new_block_addr);
+      BlockHeader * new_block = (BlockHeader *) new_block_addr;              
+      SET_NEXT(new_block, GET_NEXT(block));
+      SET_FREE(new_block, 1);
+      TABLE_MARK(new_block, 1);
+      SET_NEXT(block, new_block);
+      free_blocks++;
     }
-  } while (current != search_start);
-  return NULL;
+    SET_FREE(block, 0);
+    TABLE_MARK(block, 0);
+    free_blocks--;
+  }
+#ifdef MM_WILDERNESS
+  else {
+    block = bump_allocate(aligned_size);   // Only when no recycled block fits
+  }
+#endif
+  if (block == NULL) return NULL;
+#ifdef MM_NEXT_FIT
+  current = GET_NEXT(block);   // Next search resumes after this allocation
+#endif
+#ifdef MM_DEBUG
+  set_guards(block, payload_size);
+#endif
+  void * result = (void*)(block->user_block + GUARD_WORDS);
+#ifdef MM_PROFILE
+  simple_profile_alloc(result, size);
+#endif
+  return result;
+}
+
+/**
+ * @name    simple_usable_size
+ * @brief   Number of bytes that may be used from a pointer returned by simple_malloc
+ */
+size_t simple_usable_size(void * ptr) {
+  if (ptr == NULL) return 0;
+  BlockHeader * block = (BlockHeader*)((uintptr_t)ptr - sizeof(BlockHeader) - GUARD_WORDS * sizeof(uint64_t));
+#ifdef MM_DEBUG
+  return block->user_block[0] ^ CANARY_FRONT;
+#else
+  return SIZE(block);
+#endif
 }
 
 /**
@@ -162,13 +685,60 @@ void* simple_malloc(size_t size) {
  */
 void simple_free(void * ptr) {
   if (ptr == NULL) return;
-  BlockHeader * block = (BlockHeader*)((uintptr_t)ptr - sizeof(BlockHeader));  
-  if (GET_FREE(block) == 1) {
+  BlockHeader * block = (BlockHeader*)((uintptr_t)ptr - sizeof(BlockHeader) - GUARD_WORDS * sizeof(uint64_t));  
+  if (GET_FREE(block) == 1 || GET_CACHED(block)) {
+    return;   // Already freed
+  }
+#ifdef MM_DEBUG
+  if (check_guards(block)) {
+    fprintf(stderr, "simple_free: guard word damaged for block at %p\n", ptr);
+    abort();
+  }
+#endif
+#ifdef MM_PROFILE
+  simple_profile_free(ptr);
+#endif
+#ifdef MM_SIZE_CACHE
+  /* Small blocks stay allocated in the cache of their size class */
+  size_t c = SIZE(block) / MIN_SIZE;
+  if (SIZE(block) <= SIMPLE_CACHE_MAX && simple_cache_count[c] < SIMPLE_CACHE_LIMIT) {
+    *(uintptr_t *) ptr = (uintptr_t) simple_cache_head[c] | CACHED_FLAG_MASK;
+    block->next = (BlockHeader *) ((uintptr_t) block->next | CACHED_FLAG_MASK);
+    simple_cache_head[c] = ptr;
+    simple_cache_count[c]++;
     return;
   }
+#endif
   SET_FREE(block, 1);
+  TABLE_MARK(block, 1);
+  free_blocks++;
   coalesce_free_blocks(block);
+#ifdef MM_WILDERNESS
+  /* If block went back to the wilderness, so does the free run before it */
+  if (block == top && free_blocks > 0) {
+    coalesce_free_blocks(free_run_before_top());
+  }
+#endif
   ptr = NULL; // Prevent dangling pointer
 }
 
+/**
+ * @name    simple_set_root
+ * @brief   Stores a pointer to a root object
+ */
+void simple_set_root(int index, void * ptr) {
+  if (first == NULL) simple_init();       // Attaches the persistent roots
+  if (index >= 0 && index < SIMPLE_ROOTS) roots[index] = ptr;
+}
+
+/**
+ * @name    simple_get_root
+ * @brief   Returns the root pointer stored at index
+ */
+void * simple_get_root(int index) {
+  if (first == NULL) simple_init();
+  if (index < 0 || index >= SIMPLE_ROOTS) return NULL;
+  return roots[index];
+}
+
 #include "mm_aux.c"
\ No newline at end of file
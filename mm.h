@@ -6,11 +6,15 @@
  *
  */
 
+#ifndef MM_H_
+#define MM_H_
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
-#define FREE_FLAG_MASK 0x1
+#define FREE_FLAG_MASK   0x1
+#define CACHED_FLAG_MASK 0x4
 
 /**
  * @name    simple_malloc
@@ -27,18 +31,79 @@ void * simple_malloc(size_t size);
 void simple_free(void * ptr);
 
 
+/**
+ * @name    simple_usable_size
+ * @brief   Number of bytes that can be used from a pointer returned by simple_malloc.
+ * @retval  The usable size, at least the size requested, or 0 for NULL.
+ */
+size_t simple_usable_size(void * ptr);
+
+
 /**
  * @name    The lowest address of the memory you will manage
  * @brief   This points to the lowest address of memory you will manage
  */
+#ifdef MM_GROWABLE
+extern uintptr_t memory_start;        // Set when a growable heap is reserved on first use
+#else
 extern const uintptr_t memory_start;
+#endif
 
 
 /**
  * @name    The limit of the memory you will manage
  * @brief   This points to the first address of memory you will NOT manage
  */
+#ifdef MM_GROWABLE
+extern uintptr_t memory_end;          // Moves up as a growable heap grows
+#else
 extern const uintptr_t memory_end;
+#endif
+
+/* Number of root pointers kept by simple_set_root */
+#define SIMPLE_ROOTS 16
+
+/**
+ * @name    simple_set_root
+ * @brief   Stores a pointer to a root object. With MM_PERSISTENT the roots are kept
+ *          in the heap file, so a restarted process finds its data through them.
+ */
+void simple_set_root(int index, void * ptr);
+
+/**
+ * @name    simple_get_root
+ * @brief   Returns the root pointer stored at index, or NULL if none
+ */
+void * simple_get_root(int index);
+
+#ifdef MM_PERSISTENT
+/* Bytes before memory_start that hold the persistent heap header */
+#define SIMPLE_PERSISTENT_HEADER_SIZE 4096
+
+/**
+ * @name    memory_map_persistent
+ * @brief   Maps the heap file at its fixed address (see memory_setup.c)
+ * @retval  Pointer to the header page or NULL; *created is set if the file is new
+ */
+void * memory_map_persistent(int * created);
+#endif
+
+#ifdef MM_GROWABLE
+/**
+ * @name    memory_reserve
+ * @brief   Reserves the address space of the heap and sets memory_start and memory_end
+ *          (see memory_setup.c). SIMPLE_HEAP_RESERVE overrides the size of the reservation.
+ * @retval  0 on success, otherwise 1
+ */
+int memory_reserve(void);
+
+/**
+ * @name    memory_grow
+ * @brief   Moves memory_end up by at least bytes within the reservation
+ * @retval  0 on success, otherwise 1
+ */
+int memory_grow(size_t bytes);
+#endif
 
 /**
  * @name    simple_macro_test
@@ -47,10 +112,116 @@ extern const uintptr_t memory_end;
  */
 int simple_macro_test(void);
 
+/**
+ * @name    simple_heap_check
+ * @brief   Walks the whole block list once and verifies its structure.
+ *          When built with MM_DEBUG the guard words of allocated blocks are checked too.
+ * @retval  0 if ok, otherwise a positive number indicating the error cause
+ */
+int simple_heap_check(void);
+
 /**
  * @name    simple_block_dump
  * @brief   Dumps the current list of blocks on standard out
  */
 void simple_block_dump(void);
 
+/**
+ * @name    simple_profile_dump
+ * @brief   Writes the sampling heap profile to out: estimated live and total
+ *          bytes per allocation call stack. Requires a build with MM_PROFILE.
+ */
+void simple_profile_dump(FILE * out);
+
+/**
+ * @name    simple_profile_set_interval
+ * @brief   Sets the mean number of bytes between samples, 0 for the default
+ *          (SIMPLE_PROFILE_INTERVAL or 512 KB). Requires a build with MM_PROFILE.
+ */
+void simple_profile_set_interval(size_t bytes);
+
+/* Formats understood by simple_heap_export */
+#define SIMPLE_EXPORT_CSV     0   // One "offset,size,free" line per block
+#define SIMPLE_EXPORT_BINARY  1   // Header followed by one record per run of blocks in the same state
+
+#define SIMPLE_EXPORT_MAGIC   "MMHEAP1"
+
+/* Header of the binary export */
+typedef struct {
+  char     magic[8];              // SIMPLE_EXPORT_MAGIC
+  uint64_t heap_size;             // Bytes from the first block to the end sentinel
+} SimpleExportHeader;
+
+/* One run of adjacent blocks with the same state in the binary export */
+typedef struct {
+  uint64_t offset;                // Offset of the first block from the start of the heap
+  uint64_t size;                  // Bytes covered by the run, block headers included
+  uint32_t blocks;                // Number of blocks in the run
+  uint32_t free;                  // 1 if the blocks are free, 0 if allocated, 2 for the wilderness block, 3 if cached
+} SimpleExportRun;
+
+/**
+ * @name    simple_heap_export
+ * @brief   Writes a snapshot of the block list to out for offline analysis (see heap_frag).
+ *          Sizes are the bytes from a block to the next one, header included.
+ *          The free column is 1 for free, 0 for allocated, 2 for the wilderness block
+ *          and 3 for blocks held in a size class cache.
+ * @retval  0 if ok, otherwise a positive number indicating the error cause
+ */
+int simple_heap_export(FILE * out, int format);
+
+/*
+ * Size class caches. Freed blocks of up to SIMPLE_CACHE_MAX bytes are kept
+ * allocated on a per class list and handed out again without a search.
+ * Builds that track individual blocks (MM_DEBUG, MM_PROFILE) or keep the
+ * heap in a file (MM_PERSISTENT) do not use them.
+ */
+#if !defined(MM_DEBUG) && !defined(MM_PROFILE) && !defined(MM_PERSISTENT)
+#define MM_SIZE_CACHE
+#endif
+
+#define SIMPLE_CACHE_MAX      128     // Largest block size kept in a cache
+#define SIMPLE_CACHE_LIMIT    256     // Blocks kept per size class
+#define SIMPLE_CACHE_CLASSES  (SIMPLE_CACHE_MAX / 8 + 1)
+#define SIMPLE_SIZE_CLASS(size) ((size) == 0 ? 1 : ((size) + 7) >> 3)
+
+#ifdef MM_SIZE_CACHE
+/* Heads of the cached blocks per size class; the first word of each block links to the next.
+ * The link and the block header both carry CACHED_FLAG_MASK, so freeing a cached block again
+ * is recognized whether the pointer is the block or a preload pointer padded past the link */
+extern void * simple_cache_head[SIMPLE_CACHE_CLASSES];
+extern unsigned simple_cache_count[SIMPLE_CACHE_CLASSES];
+
+/**
+ * @name    simple_cache_pop
+ * @brief   Takes the first block of size class c out of its cache, or NULL if it is empty
+ */
+__attribute__((always_inline))
+static inline void * simple_cache_pop(size_t c) {
+  void * ptr = simple_cache_head[c];
+  if (ptr != NULL) {
+    simple_cache_head[c] = (void *) (*(uintptr_t *) ptr & ~(uintptr_t) CACHED_FLAG_MASK);
+    ((uintptr_t *) ptr)[-1] &= ~(uintptr_t) CACHED_FLAG_MASK;   // The block header
+    simple_cache_count[c]--;
+  }
+  return ptr;
+}
+
+/**
+ * @name    simple_malloc_cached
+ * @brief   Pops a block from the cache of the size class of size and falls back
+ *          to the out-of-line allocator if it is empty. Not thread safe.
+ */
+__attribute__((always_inline))
+static inline void * simple_malloc_cached(size_t size) {
+  void * ptr = simple_cache_pop(SIMPLE_SIZE_CLASS(size));
+  if (ptr != NULL) return ptr;
+  return (simple_malloc)(size);
+}
+
+/* Calls with a small constant size resolve their size class at compile time */
+#define simple_malloc(size) \
+  (__builtin_constant_p(size) && (size) <= SIMPLE_CACHE_MAX ? simple_malloc_cached(size) : (simple_malloc)(size))
+#endif
 
+#endif /* MM_H_ */
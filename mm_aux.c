@@ -84,3 +84,123 @@ void simple_block_dump(void) {
 }
 
 
+
+
+
+/**
+ * @name    simple_heap_check
+ * @brief   Walks the block list once and verifies its structure
+ * @retval  0 if ok, otherwise a positive number indicating the error cause
+ */
+int simple_heap_check(void) {
+  BlockHeader * p;
+  BlockHeader * n;
+  int rover_found = 0;
+  int top_found = 0;
+  size_t free_count = 0;
+#ifdef MM_SIDE_TABLE
+  size_t blocks = 0;
+  size_t table_blocks = 0;
+#endif
+
+  if (first == NULL) return 0;
+
+  p = first;
+  while (p != last) {
+    if (p == current) rover_found = 1;
+    if (p == top) top_found = 1;
+    if ((uintptr_t) p < memory_start || (uintptr_t) p >= memory_end) return 1;  // Out of range
+    if ((uintptr_t) p & (MIN_SIZE-1)) return 2;                               // Misaligned
+    n = GET_NEXT(p);
+    if (n <= p) return 3;                          // Blocks must be in address order
+#ifdef MM_DEBUG
+    if (GET_FREE(p) == 0 && p != top && check_guards(p)) return 4;  // Payload overrun
+#endif
+#ifdef MM_SIDE_TABLE
+    size_t g = GRANULE(p);
+    if (!(start_bits[g / WORD_BITS] >> (g % WORD_BITS) & 1)) return 7;                // Block missing in table
+    if ((free_bits[g / WORD_BITS] >> (g % WORD_BITS) & 1) != GET_FREE(p)) return 8;   // Wrong state in table
+    blocks++;
+#endif
+#ifdef MM_WILDERNESS
+    if (GET_FREE(p) && (n == top || (top == NULL && n == last))) return 12;   // Free run not returned to the wilderness
+#endif
+    free_count += GET_FREE(p);
+    p = n;
+  }
+  if (GET_NEXT(last) != first) return 5;           // List is not closed
+  if (!rover_found && current != last) return 6;   // Roving pointer is not a block
+  if (free_count != free_blocks) return 10;        // Free block count is off
+  if (top != NULL && (!top_found || GET_NEXT(top) != last)) return 11;  // Wilderness is not the last block
+#ifdef MM_SIDE_TABLE
+  /* Every start bit must belong to a block (last included) */
+  for (size_t w = 0; w < table_words; w++) {
+    table_blocks += __builtin_popcountll(start_bits[w]);
+  }
+  if (table_blocks != blocks + 1) return 9;         // Stale blocks in table
+#endif
+  return 0;
+}
+
+
+#define EXPORT_BATCH 256    // Runs written per fwrite in the binary export
+
+/**
+ * @name    export_state
+ * @brief   State of block p in a heap export. Blocks in a size class cache
+ *          are marked allocated in the list but are free memory.
+ */
+static uint32_t export_state(BlockHeader * p) {
+  if (p == top) return 2;
+  if (GET_CACHED(p)) return 3;
+  return GET_FREE(p);
+}
+
+/**
+ * @name    simple_heap_export
+ * @brief   Writes a snapshot of the block list to out for offline analysis
+ * @retval  0 if ok, 1 if the heap is not initialized, 2 on write errors, 3 for an unknown format
+ */
+int simple_heap_export(FILE * out, int format) {
+  BlockHeader * p;
+  SimpleExportHeader header = { SIMPLE_EXPORT_MAGIC, 0 };
+  SimpleExportRun batch[EXPORT_BATCH];
+  size_t count = 0;
+
+  if (first == NULL) return 1;
+  if (format != SIMPLE_EXPORT_CSV && format != SIMPLE_EXPORT_BINARY) return 3;
+
+  if (format == SIMPLE_EXPORT_CSV) {
+    if (fputs("offset,size,free\n", out) == EOF) return 2;
+    for (p = first; p != last; p = GET_NEXT(p)) {
+      fprintf(out, "%lu,%lu,%d\n", (uintptr_t) p - (uintptr_t) first,
+              (uintptr_t) GET_NEXT(p) - (uintptr_t) p, export_state(p));
+    }
+    return ferror(out) ? 2 : 0;
+  }
+
+  header.heap_size = (uintptr_t) last - (uintptr_t) first;
+  if (fwrite(&header, sizeof(header), 1, out) != 1) return 2;
+
+  for (p = first; p != last; p = GET_NEXT(p)) {
+    uint64_t size = (uintptr_t) GET_NEXT(p) - (uintptr_t) p;
+    uint32_t state = export_state(p);
+    if (count > 0 && batch[count-1].free == state) {
+      batch[count-1].size += size;
+      batch[count-1].blocks++;
+      continue;
+    }
+    if (count == EXPORT_BATCH) {
+      if (fwrite(batch, sizeof(SimpleExportRun), count - 1, out) != count - 1) return 2;
+      batch[0] = batch[count-1];    // Last run may still grow
+      count = 1;
+    }
+    batch[count].offset = (uintptr_t) p - (uintptr_t) first;
+    batch[count].size   = size;
+    batch[count].blocks = 1;
+    batch[count].free   = state;
+    count++;
+  }
+  if (count > 0 && fwrite(batch, sizeof(SimpleExportRun), count, out) != count) return 2;
+  return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file   mm_preload.c
+ * @brief  Standard malloc family on top of simple_malloc.
+ *
+ * Built into libsimplemalloc.so so it can be loaded in front of the C
+ * library with LD_PRELOAD=./libsimplemalloc.so. All calls into the
+ * allocator are serialized by one mutex. The heap is built with
+ * MM_GROWABLE: it starts small in a large reservation of address space
+ * (SIMPLE_HEAP_RESERVE, default 1 TB) and grows on demand, and pages are
+ * only backed by memory once the allocator touches them.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mm.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+/* Alignment of plain malloc results, as promised by the C library on 64 bit targets */
+#define DEFAULT_ALIGNMENT  16
+
+/*
+ * When an aligned pointer has to be moved forward from the pointer given by
+ * simple_malloc, the word just before it holds the distance back to that
+ * pointer with PADDING_TAG in the low bits. An allocated block header has
+ * 000 there and an MM_DEBUG guard word has 111, so the tag is unambiguous.
+ * A block in a size class cache has 100 in its header and in the link that
+ * overwrote its first word, so a second free of it is ignored by simple_free.
+ */
+#define PADDING_TAG        0x2
+#define TAG_MASK           0x7
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_heap(void)   { pthread_mutex_lock(&heap_lock); }
+static void unlock_heap(void) { pthread_mutex_unlock(&heap_lock); }
+
+/**
+ * @name  register_fork_handlers
+ * @brief Keep the heap lock consistent in the child of a fork
+ */
+__attribute__((constructor))
+static void register_fork_handlers(void) {
+  pthread_atfork(lock_heap, unlock_heap, unlock_heap);
+}
+
+/**
+ * @name  in_heap
+ * @brief Check whether ptr was handed out by this allocator
+ */
+static int in_heap(void *ptr) {
+  return (uintptr_t) ptr >= memory_start && (uintptr_t) ptr < memory_end;
+}
+
+/**
+ * @name  raw_pointer
+ * @brief Find the pointer returned by simple_malloc for a user pointer
+ */
+static void * raw_pointer(void *ptr) {
+  uintptr_t tag = ((uintptr_t *) ptr)[-1];
+  if ((tag & TAG_MASK) == PADDING_TAG) {
+    return (void *) ((uintptr_t) ptr - (tag & ~(uintptr_t) TAG_MASK));
+  }
+  return ptr;
+}
+
+/**
+ * @name  aligned_allocate
+ * @brief Allocate size bytes aligned to alignment (a power of two) with the heap lock held
+ */
+static void * aligned_allocate(size_t alignment, size_t size) {
+  size_t extra = alignment > sizeof(uintptr_t) ? alignment - sizeof(uintptr_t) : 0;
+  if (size > SIZE_MAX - extra) return NULL;
+
+  uintptr_t raw = (uintptr_t) simple_malloc(size + extra);
+  if (raw == 0) return NULL;
+
+  uintptr_t aligned = (raw + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  if (aligned != raw) {
+    ((uintptr_t *) aligned)[-1] = (aligned - raw) | PADDING_TAG;
+  }
+  return (void *) aligned;
+}
+
+/**
+ * @name  usable_size
+ * @brief Usable bytes behind a user pointer
+ */
+static size_t usable_size(void *ptr) {
+  void *raw = raw_pointer(ptr);
+  return simple_usable_size(raw) - ((uintptr_t) ptr - (uintptr_t) raw);
+}
+
+/**
+ * @name  checked_allocate
+ * @brief Lock, allocate and set errno on failure
+ */
+static void * checked_allocate(size_t alignment, size_t size) {
+  lock_heap();
+  void *ptr = aligned_allocate(alignment, size);
+  unlock_heap();
+  if (ptr == NULL) errno = ENOMEM;
+  return ptr;
+}
+
+EXPORT void * malloc(size_t size) {
+  return checked_allocate(DEFAULT_ALIGNMENT, size);
+}
+
+EXPORT void free(void *ptr) {
+  if (ptr == NULL || !in_heap(ptr)) return;
+  lock_heap();
+  simple_free(raw_pointer(ptr));
+  unlock_heap();
+}
+
+EXPORT void * calloc(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void *ptr = checked_allocate(DEFAULT_ALIGNMENT, count * size);
+  if (ptr != NULL) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+EXPORT void * realloc(void *ptr, size_t size) {
+  if (ptr == NULL) return malloc(size);
+  if (!in_heap(ptr)) {
+    errno = ENOMEM;   // Not ours, its size is unknown; the original block is left alone
+    return NULL;
+  }
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  lock_heap();
+  size_t old_size = usable_size(ptr);
+  if (old_size >= size) {
+    unlock_heap();
+    return ptr;
+  }
+  void *new_ptr = aligned_allocate(DEFAULT_ALIGNMENT, size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    simple_free(raw_pointer(ptr));
+  }
+  unlock_heap();
+
+  if (new_ptr == NULL) errno = ENOMEM;
+  return new_ptr;
+}
+
+EXPORT int posix_memalign(void **result, size_t alignment, size_t size) {
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) return EINVAL;
+  void *ptr = checked_allocate(alignment, size);
+  if (ptr == NULL) return ENOMEM;
+  *result = ptr;
+  return 0;
+}
+
+EXPORT void * aligned_alloc(size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return checked_allocate(alignment < DEFAULT_ALIGNMENT ? DEFAULT_ALIGNMENT : alignment, size);
+}
+
+EXPORT void * memalign(size_t alignment, size_t size) {
+  return aligned_alloc(alignment, size);
+}
+
+EXPORT void * valloc(size_t size) {
+  return checked_allocate((size_t) sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+  if (ptr == NULL || !in_heap(ptr)) return 0;
+  lock_heap();
+  size_t size = usable_size(ptr);
+  unlock_heap();
+  return size;
+}
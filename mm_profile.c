@@ -0,0 +1,338 @@
+/**
+ * @file   mm_profile.c
+ * @brief  Sampling heap profiler for simple_malloc.
+ *
+ * Built with MM_PROFILE ("make PROFILE=1") the allocator reports every
+ * allocation here. On average one sample is taken per
+ * SIMPLE_PROFILE_INTERVAL bytes (default 512 KB): the allocation that
+ * crosses the sampling point has its backtrace recorded and is remembered
+ * until it is freed. All state lives in fixed tables, so the profiler
+ * never allocates memory itself.
+ *
+ * Set SIMPLE_PROFILE_FILE to write a report when the process exits. The
+ * process id is appended to the name (SIMPLE_PROFILE_FILE.<pid>), so under
+ * LD_PRELOAD every process of a pipeline or process tree keeps its own report.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "mm.h"
+#include "mm_profile.h"
+
+#ifdef MM_PROFILE
+
+#include <execinfo.h>
+#include <link.h>
+
+#define DEFAULT_INTERVAL  (512 * 1024)   // Mean bytes between samples
+#define MAX_DEPTH         16             // Frames recorded per sample
+#define SKIP_FRAMES       2              // simple_profile_alloc and simple_malloc
+#define MAX_OWN_FRAMES    8              // Allocator frames stripped in a shared object
+#define MAX_SITES         1024           // Distinct call stacks, power of two
+#define MAX_LIVE          8192           // Sampled blocks not yet freed, power of two
+
+/* A call stack that sampled allocations came from */
+typedef struct {
+  uint64_t hash;                         // 0 marks an unused slot
+  int      depth;
+  void *   frames[MAX_DEPTH];
+  uint64_t live_bytes;                   // Estimated bytes still allocated
+  uint64_t total_bytes;                  // Estimated bytes ever allocated
+  uint64_t live_samples;
+  uint64_t total_samples;
+} Site;
+
+/* A sampled block that has not been freed yet */
+typedef struct {
+  void *   ptr;                          // NULL for unused slots
+  uint32_t site;
+  uint64_t weight;                       // Bytes this sample stands for
+} LiveSample;
+
+static Site       sites[MAX_SITES];
+static LiveSample live[MAX_LIVE];
+static uint64_t   interval = 0;          // 0 until the profiler is initialized
+static int64_t    bytes_until_sample = 0;
+static uint64_t   random_state = 0x9E3779B97F4A7C15ULL;
+static uint64_t   live_count = 0;
+static uint64_t   dropped_samples = 0;
+static int        in_profiler = 0;       // Guards against allocations made by backtrace()
+static uintptr_t  own_text_start = 0;    // Code of the shared object the profiler is
+static uintptr_t  own_text_end = 0;      // linked into, empty in the main program
+
+/**
+ * @name  next_gap
+ * @brief Bytes until the next sample, exponential with mean interval
+ *
+ * Exponential gaps make every allocated byte equally likely to be the
+ * sampling point, independent of the allocations before it, so an
+ * allocation of size bytes is sampled with probability
+ * 1 - exp(-size / interval). sample_weight divides by that probability.
+ */
+static int64_t next_gap(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  double u = ((random_state >> 11) + 1) / 9007199254740992.0;   // (0, 1]
+  return (int64_t) (-log(u) * interval) + 1;
+}
+
+/**
+ * @name  sample_weight
+ * @brief Bytes a sampled allocation of size bytes stands for
+ */
+static uint64_t sample_weight(size_t size) {
+  if (size == 0) return interval;        // The limit for small sizes
+  return (uint64_t) (size / -expm1(-(double) size / interval) + 0.5);
+}
+
+/**
+ * @name  find_own_text
+ * @brief dl_iterate_phdr callback recording the code segment that holds data
+ *
+ * Only a shared object is recorded: in the main program the frames above
+ * the allocator are the application's own and SKIP_FRAMES applies.
+ */
+static int find_own_text(struct dl_phdr_info *info, size_t size, void *data) {
+  uintptr_t self = (uintptr_t) data;
+  int i;
+
+  for (i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) continue;
+    if (self < start || self >= start + phdr->p_memsz) continue;
+    if (info->dlpi_name != NULL && info->dlpi_name[0] != '\0') {
+      own_text_start = start;
+      own_text_end = start + phdr->p_memsz;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @name  profile_init
+ * @brief Read the sampling interval and load the unwinder before any sample is taken
+ */
+__attribute__((constructor))
+static void profile_init(void) {
+  void *frame;
+  if (interval != 0 || in_profiler) return;
+  in_profiler = 1;
+  backtrace(&frame, 1);                  // The first call may allocate while loading libgcc
+  dl_iterate_phdr(find_own_text, (void *) (uintptr_t) simple_profile_alloc);
+  in_profiler = 0;
+  const char *env = getenv("SIMPLE_PROFILE_INTERVAL");
+  interval = env != NULL && atol(env) > 0 ? (uint64_t) atol(env) : DEFAULT_INTERVAL;
+  bytes_until_sample = next_gap();
+}
+
+/**
+ * @name  ptr_hash
+ * @brief Hash of a block address used for the live table
+ */
+static uint64_t ptr_hash(void *ptr) {
+  return ((uintptr_t) ptr >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * @name  find_site
+ * @brief Find or create the site for a call stack
+ * @retval Index into sites, or -1 if the table is full
+ */
+static int find_site(void **frames, int depth) {
+  uint64_t hash = 1469598103934665603ULL;
+  int i, slot;
+
+  for (i = 0; i < depth; i++) {
+    hash = (hash ^ (uintptr_t) frames[i]) * 1099511628211ULL;
+  }
+  if (hash == 0) hash = 1;
+
+  for (i = 0, slot = hash & (MAX_SITES - 1); i < MAX_SITES; i++, slot = (slot + 1) & (MAX_SITES - 1)) {
+    Site *s = &sites[slot];
+    if (s->hash == 0) {
+      s->hash = hash;
+      s->depth = depth;
+      for (int f = 0; f < depth; f++) s->frames[f] = frames[f];
+      return slot;
+    }
+    if (s->hash == hash && s->depth == depth) return slot;
+  }
+  return -1;
+}
+
+/**
+ * @name  simple_profile_alloc
+ * @brief Count the allocation and record a sample when the byte budget runs out
+ */
+__attribute__((noinline))
+void simple_profile_alloc(void * ptr, size_t size) {
+  void *frames[MAX_DEPTH + MAX_OWN_FRAMES];
+  int depth, skip, site, i, slot;
+
+  if (in_profiler) return;
+  if (interval == 0) profile_init();
+  bytes_until_sample -= (int64_t) size;
+  if (bytes_until_sample > 0) return;
+  bytes_until_sample = next_gap();
+
+  in_profiler = 1;
+  depth = backtrace(frames, MAX_DEPTH + MAX_OWN_FRAMES);
+  in_profiler = 0;
+
+  /* Under LD_PRELOAD the malloc wrappers sit between the caller and
+   * simple_malloc; strip every leading frame of our own shared object */
+  skip = SKIP_FRAMES;
+  if (own_text_end != 0) {
+    for (skip = 0; skip < depth && skip < MAX_OWN_FRAMES; skip++) {
+      uintptr_t pc = (uintptr_t) frames[skip];
+      if (pc < own_text_start || pc >= own_text_end) break;
+    }
+  }
+  depth -= skip;
+  if (depth < 0) depth = 0;
+  if (depth > MAX_DEPTH) depth = MAX_DEPTH;
+
+  site = find_site(frames + skip, depth);
+  if (site < 0 || live_count == MAX_LIVE / 2) {   // Keep the live table at most half full
+    dropped_samples++;
+    return;
+  }
+
+  uint64_t weight = sample_weight(size);
+  sites[site].live_bytes += weight;
+  sites[site].total_bytes += weight;
+  sites[site].live_samples++;
+  sites[site].total_samples++;
+
+  for (i = 0, slot = ptr_hash(ptr) & (MAX_LIVE - 1); i < MAX_LIVE; i++, slot = (slot + 1) & (MAX_LIVE - 1)) {
+    if (live[slot].ptr == NULL) {
+      live[slot].ptr = ptr;
+      live[slot].site = site;
+      live[slot].weight = weight;
+      live_count++;
+      return;
+    }
+  }
+}
+
+/**
+ * @name  simple_profile_free
+ * @brief Move a sampled block from live to freed
+ *
+ * The live table uses linear probing without tombstones: the entries
+ * after the removed one are shifted back into the hole, so every probe
+ * still ends at the first empty slot however many samples were freed.
+ */
+void simple_profile_free(void * ptr) {
+  int i, slot, hole, home;
+
+  if (live_count == 0) return;
+  for (i = 0, slot = ptr_hash(ptr) & (MAX_LIVE - 1); i < MAX_LIVE; i++, slot = (slot + 1) & (MAX_LIVE - 1)) {
+    if (live[slot].ptr == NULL) return;
+    if (live[slot].ptr == ptr) break;
+  }
+  if (i == MAX_LIVE) return;
+
+  sites[live[slot].site].live_bytes -= live[slot].weight;
+  sites[live[slot].site].live_samples--;
+  live_count--;
+
+  /* The table is at most half full, so the run always ends at an empty slot */
+  hole = slot;
+  for (slot = (hole + 1) & (MAX_LIVE - 1); live[slot].ptr != NULL; slot = (slot + 1) & (MAX_LIVE - 1)) {
+    home = ptr_hash(live[slot].ptr) & (MAX_LIVE - 1);
+    if (((slot - home) & (MAX_LIVE - 1)) >= ((slot - hole) & (MAX_LIVE - 1))) {
+      live[hole] = live[slot];              // The hole lies on this entry's probe path
+      hole = slot;
+    }
+  }
+  live[hole].ptr = NULL;
+}
+
+/**
+ * @name    simple_profile_set_interval
+ * @brief   Change the mean sampling interval, 0 restores the default
+ */
+void simple_profile_set_interval(size_t bytes) {
+  if (interval == 0) profile_init();
+  interval = bytes > 0 ? bytes : DEFAULT_INTERVAL;
+  bytes_until_sample = next_gap();
+}
+
+/**
+ * @name    simple_profile_dump
+ * @brief   Writes the per call site report, largest live bytes first
+ */
+void simple_profile_dump(FILE * out) {
+  int order[MAX_SITES];
+  int count = 0;
+  int i, j;
+  uint64_t live_total = 0, total = 0;
+
+  for (i = 0; i < MAX_SITES; i++) {
+    if (sites[i].hash == 0) continue;
+    live_total += sites[i].live_bytes;
+    total += sites[i].total_bytes;
+    /* Insertion sort on live bytes, the table is small */
+    for (j = count; j > 0 && sites[order[j-1]].live_bytes < sites[i].live_bytes; j--) {
+      order[j] = order[j-1];
+    }
+    order[j] = i;
+    count++;
+  }
+
+  fprintf(out, "Heap profile: %lu live bytes, %lu total bytes, sampling interval %lu bytes",
+          live_total, total, interval);
+  if (dropped_samples > 0) fprintf(out, ", %lu samples dropped", dropped_samples);
+  fprintf(out, "\n");
+
+  for (i = 0; i < count; i++) {
+    Site *s = &sites[order[i]];
+    fprintf(out, "\n%lu live bytes (%lu samples), %lu total bytes (%lu samples)\n",
+            s->live_bytes, s->live_samples, s->total_bytes, s->total_samples);
+    fflush(out);
+    backtrace_symbols_fd(s->frames, s->depth, fileno(out));
+  }
+  fflush(out);
+}
+
+/**
+ * @name  profile_report_at_exit
+ * @brief Write the report to SIMPLE_PROFILE_FILE.<pid>, if SIMPLE_PROFILE_FILE is set
+ */
+__attribute__((destructor))
+static void profile_report_at_exit(void) {
+  const char *path = getenv("SIMPLE_PROFILE_FILE");
+  char name[4096];
+  if (path == NULL) return;
+  if (snprintf(name, sizeof(name), "%s.%ld", path, (long) getpid()) >= (int) sizeof(name)) return;
+  FILE *out = fopen(name, "w");
+  if (out == NULL) return;
+  simple_profile_dump(out);
+  fclose(out);
+}
+
+#else
+
+void simple_profile_alloc(void * ptr, size_t size) {
+}
+
+void simple_profile_free(void * ptr) {
+}
+
+void simple_profile_set_interval(size_t bytes) {
+}
+
+void simple_profile_dump(FILE * out) {
+  fprintf(out, "Heap profiling is not enabled, build with MM_PROFILE\n");
+}
+
+#endif
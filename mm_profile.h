@@ -0,0 +1,18 @@
+#ifndef MM_PROFILE_H_
+#define MM_PROFILE_H_
+/**
+ * Hooks used by mm.c to feed the sampling heap profiler in mm_profile.c.
+ * They are only called when the allocator is built with MM_PROFILE.
+ */
+
+#include <stddef.h>
+
+/* Called with the result of every successful simple_malloc(size) */
+extern void
+simple_profile_alloc(void * ptr, size_t size);
+
+/* Called for every pointer passed to simple_free before it is released */
+extern void
+simple_profile_free(void * ptr);
+
+#endif /* MM_PROFILE_H_ */
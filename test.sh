@@ -16,4 +16,30 @@ out=";"
 in="abbabcacbacq"
 out="0;"
 
-[[ $(./cmd_int <<< "$in") == "$out"* ]] && echo "PASSED" || echo "FAILED"
\ No newline at end of file
+[[ $(./cmd_int <<< "$in") == "$out"* ]] && echo "PASSED" || echo "FAILED"
+
+in="$(printf 'a%.0s' {1..500})q"
+out="$(seq -s, 0 499);"
+
+[[ $(./cmd_int <<< "$in") == "$out"* ]] && echo "PASSED" || echo "FAILED"
+
+# Persistent heap: the list at root 0 survives a restart, a file locked by another
+# process is not used, and a file with a damaged block header is reinitialized
+# (the first block follows the 4 KB header page)
+
+export SIMPLE_HEAP_FILE=$(mktemp -u)
+
+./persist_test write 1000 && ./persist_test check 1000 && echo "PASSED" || echo "FAILED"
+
+err=$(flock -n "$SIMPLE_HEAP_FILE" ./persist_test write 10 2>&1)
+[[ $? != 0 && $(grep -c "in use" <<< "$err") == 1 ]] && ./persist_test check 1000 && echo "PASSED" || echo "FAILED"
+
+printf '\xff\xff\xff\xff\xff\xff\xff\x7f' | dd of="$SIMPLE_HEAP_FILE" bs=1 seek=4096 conv=notrunc 2> /dev/null
+err=$(./persist_test empty 2>&1) && [[ $err == *"damaged"* ]] && echo "PASSED" || echo "FAILED"
+
+rm -f "$SIMPLE_HEAP_FILE"
+
+# Preload library: the C library allocator interface runs on simple_malloc,
+# including an allocation larger than the initial heap
+
+LD_PRELOAD=./libsimplemalloc.so ./preload_test && echo "PASSED" || echo "FAILED"
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+
+
+/**
+ * Test program for the persistent heap (MM_PERSISTENT). Each run is a
+ * separate process attaching to SIMPLE_HEAP_FILE, so test.sh can check
+ * what survives a restart:
+ *
+ *   persist_test write N   builds a list of N nodes in an empty heap at root 0
+ *   persist_test check N   finds the same list at root 0 after a restart
+ *   persist_test empty     finds an empty heap, e.g. after the file was damaged
+ *
+ * Exits with 0 on success.
+ */
+
+struct node {
+  int          value;
+  struct node *next;
+};
+
+int main(int argc, char ** argv) {
+  int count = argc > 2 ? atoi(argv[2]) : 0;
+  struct node *list;
+  int i;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s write|check N or %s empty\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  list = simple_get_root(0);
+
+  if (strcmp(argv[1], "write") == 0) {
+    if (list != NULL) {
+      printf("Root 0 already set in a new heap\n");
+      return 1;
+    }
+    for (i = count - 1; i >= 0; i--) {
+      struct node *n = simple_malloc(sizeof(struct node));
+      if (n == NULL) return 1;
+      n->value = i;
+      n->next = list;
+      list = n;
+    }
+    simple_set_root(0, list);
+    return 0;
+  }
+
+  if (strcmp(argv[1], "check") == 0) {
+    for (i = 0; list != NULL; i++, list = list->next) {
+      if (list->value != i) {
+        printf("Node %d holds %d\n", i, list->value);
+        return 1;
+      }
+    }
+    if (i != count) {
+      printf("Found %d of %d nodes\n", i, count);
+      return 1;
+    }
+    return simple_heap_check() != 0;
+  }
+
+  if (strcmp(argv[1], "empty") == 0) {
+    if (list != NULL) {
+      printf("Root 0 survived a reinitialization\n");
+      return 1;
+    }
+    return simple_heap_check() != 0;
+  }
+
+  fprintf(stderr, "unknown command %s\n", argv[1]);
+  return 2;
+}
@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Smoke test for libsimplemalloc.so. It is an ordinary program using
+ * the C library allocator interface; test.sh runs it with
+ *
+ *   LD_PRELOAD=./libsimplemalloc.so ./preload_test
+ *
+ * and it checks that the calls really reach simple_malloc and behave
+ * as the C library promises. Exits with 0 on success.
+ */
+
+#define CHECK(c) do { if (!(c)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #c); return 1; } } while (0)
+
+/* More than the fixed 1 GB heap the preload library used to have */
+#define LARGE_SIZE ((size_t) 1536 * 1024 * 1024)
+
+int main(int argc, char ** argv) {
+  Dl_info info;
+  char *p, *q;
+  void *aligned;
+  int i;
+
+  CHECK(dladdr((void *) malloc, &info) != 0 && info.dli_fname != NULL);
+  CHECK(strstr(info.dli_fname, "libsimplemalloc") != NULL);
+
+  p = malloc(100);
+  CHECK(p != NULL && ((uintptr_t) p & 15) == 0);
+  CHECK(malloc_usable_size(p) >= 100);
+  for (i = 0; i < 100; i++) p[i] = (char) i;
+
+  q = realloc(p, 100000);
+  CHECK(q != NULL);
+  for (i = 0; i < 100; i++) CHECK(q[i] == (char) i);
+  free(q);
+
+  CHECK(posix_memalign(&aligned, 4096, 5000) == 0);
+  CHECK(((uintptr_t) aligned & 4095) == 0);
+  memset(aligned, 1, 5000);
+  free(aligned);
+
+  p = calloc(1000, 10);
+  CHECK(p != NULL);
+  for (i = 0; i < 10000; i++) CHECK(p[i] == 0);
+  free(p);
+
+  p = malloc(LARGE_SIZE);
+  CHECK(p != NULL);
+  p[0] = 1;
+  p[LARGE_SIZE - 1] = 1;
+  free(p);
+
+  return 0;
+}